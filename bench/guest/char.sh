@@ -0,0 +1,32 @@
+# streaming throughput through the char device rings
+. /bench/lib.sh
+set -e
+
+MB=${MB:-1024}
+
+# stream <name> <block size> <devices...> - one writer and one reader
+# per device, all running in parallel, reports aggregate bytes per second
+stream() {
+        name=$1
+        bs=$2
+        shift 2
+        count=$((MB * 1024 * 1024 / bs))
+        start=$(now_ns)
+        for dev in "$@"; do
+                dd if=/dev/mynull$dev of=/dev/null bs=$bs count=$count iflag=fullblock 2>/dev/null &
+                dd if=/dev/zero of=/dev/mynull$dev bs=$bs count=$count 2>/dev/null &
+        done
+        wait
+        end=$(now_ns)
+        bytes=$((MB * 1024 * 1024 * $#))
+        result char/$name bw_kib $((bytes / 1024 * 1000000 / ((end - start) / 1000)))
+}
+
+insmod /modules/mychar.ko ndevices=4
+wait_for /dev/mynull3
+
+stream single-64k 65536 ""
+stream single-4k 4096 ""
+stream scale-4x-64k 65536 "" 1 2 3
+
+rmmod mychar
@@ -0,0 +1,36 @@
+# Helpers shared by the guest suites
+
+RUNTIME=${RUNTIME:-20}
+export RUNTIME
+
+# wait_for <path> - wait up to 10s for a device node to show up
+wait_for() {
+        i=0
+        while [ ! -e "$1" ]; do
+                i=$((i + 1))
+                if [ $i -gt 100 ]; then
+                        echo "timeout waiting for $1" >&2
+                        return 1
+                fi
+                sleep 0.1
+        done
+}
+
+# run_fio <suite> <job file> - fio json output between markers
+run_fio() {
+        echo "@@BENCH-BEGIN $1@@"
+        fio --output-format=json "/bench/$2"
+        ret=$?
+        echo "@@BENCH-END@@"
+        return $ret
+}
+
+# now_ns - monotonic enough wall clock in nanoseconds
+now_ns() {
+        date +%s%N
+}
+
+# result <suite/name> <metric> <value>
+result() {
+        echo "@@BENCH-RESULT $1 $2 $3@@"
+}
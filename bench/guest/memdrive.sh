@@ -0,0 +1,10 @@
+# fio profiles against the in-ram block device
+. /bench/lib.sh
+set -e
+
+insmod /modules/memdrive.ko nsectors=262144
+wait_for /dev/memdrive0
+
+DEV=/dev/memdrive0 run_fio memdrive memdrive.fio
+
+rmmod memdrive
@@ -0,0 +1,40 @@
+# usb drivers against gadgets looped back through dummy_hcd
+. /bench/lib.sh
+set -e
+
+modprobe dummy_hcd
+
+# no usbstick suite: its request handler completes without any usb
+# transfer, fio would only measure the block layer. It is still built.
+
+# hid: usbmouse on top of g_hid, report rate the host side keeps up with
+REPORTS=${REPORTS:-20000}
+insmod /modules/hidg_mouse.ko
+insmod /modules/usbmouse.ko
+modprobe g_hid
+wait_for /dev/hidg0
+# event0 is the i8042 keyboard, pick the node bound to the usbmouse driver
+mouse_event() {
+        for e in /sys/class/input/event*; do
+                drv=$(readlink $e/device/device/driver)
+                [ "${drv##*/}" = mouse ] && echo /dev/input/${e##*/} && return 0
+        done
+        return 1
+}
+i=0
+until EVENT=$(mouse_event); do
+        i=$((i + 1))
+        [ $i -gt 100 ] && echo "timeout waiting for usbmouse input" >&2 && exit 1
+        sleep 0.1
+done
+wait_for $EVENT
+cat $EVENT > /dev/null &
+reader=$!
+start=$(now_ns)
+dd if=/dev/zero of=/dev/hidg0 bs=4 count=$REPORTS 2>/dev/null
+end=$(now_ns)
+kill $reader
+result usbmouse/reports reports_per_s $((REPORTS * 1000000 / ((end - start) / 1000)))
+rmmod g_hid
+rmmod usbmouse
+rmmod hidg_mouse
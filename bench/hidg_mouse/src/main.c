@@ -0,0 +1,72 @@
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/usb/g_hid.h>
+
+// boot protocol mouse with wheel, matches the 4 byte report of usbmouse
+static struct hidg_func_descriptor mouse_desc = {
+        .subclass = 1, // boot interface subclass
+        .protocol = 2, // mouse
+        .report_length = 4,
+        .report_desc_length = 52,
+        .report_desc = {
+                0x05, 0x01,     // usage page (generic desktop)
+                0x09, 0x02,     // usage (mouse)
+                0xa1, 0x01,     // collection (application)
+                0x09, 0x01,     //   usage (pointer)
+                0xa1, 0x00,     //   collection (physical)
+                0x05, 0x09,     //     usage page (buttons)
+                0x19, 0x01,     //     usage minimum (1)
+                0x29, 0x03,     //     usage maximum (3)
+                0x15, 0x00,     //     logical minimum (0)
+                0x25, 0x01,     //     logical maximum (1)
+                0x95, 0x03,     //     report count (3)
+                0x75, 0x01,     //     report size (1)
+                0x81, 0x02,     //     input (data, variable, absolute)
+                0x95, 0x01,     //     report count (1)
+                0x75, 0x05,     //     report size (5)
+                0x81, 0x03,     //     input (constant) padding
+                0x05, 0x01,     //     usage page (generic desktop)
+                0x09, 0x30,     //     usage (x)
+                0x09, 0x31,     //     usage (y)
+                0x09, 0x38,     //     usage (wheel)
+                0x15, 0x81,     //     logical minimum (-127)
+                0x25, 0x7f,     //     logical maximum (127)
+                0x75, 0x08,     //     report size (8)
+                0x95, 0x03,     //     report count (3)
+                0x81, 0x06,     //     input (data, variable, relative)
+                0xc0,           //   end collection
+                0xc0            // end collection
+        }
+};
+
+static void mouse_release(struct device *dev)
+{
+}
+
+// g_hid picks up its functions from "hidg" platform devices
+static struct platform_device mouse_device = {
+        .name = "hidg",
+        .id = 0,
+        .num_resources = 0,
+        .resource = 0,
+        .dev.platform_data = &mouse_desc,
+        .dev.release = mouse_release,
+};
+
+static int __init hidg_mouse_init (void)
+{
+        return platform_device_register(&mouse_device);
+}
+
+static void __exit hidg_mouse_exit (void)
+{
+        platform_device_unregister(&mouse_device);
+}
+
+MODULE_AUTHOR("Roger Knecht");
+MODULE_DESCRIPTION("hid gadget mouse for the usbmouse benchmark");
+MODULE_LICENSE("GPL");
+module_init(hidg_mouse_init);
+module_exit(hidg_mouse_exit);
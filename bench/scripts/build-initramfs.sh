@@ -0,0 +1,44 @@
+#!/bin/sh
+# build-initramfs.sh <kernel dir> <flavor dir> <busybox> <fio> <suites>
+#
+# Packs busybox, fio, the kernel's own modules, our modules and the guest
+# side scripts into <flavor dir>/initramfs.cpio.gz.
+set -e
+
+kdir=$1
+out=$2
+busybox=$3
+fio=$4
+suites=$5
+here=$(cd "$(dirname "$0")/.." && pwd)
+root=$out/rootfs
+
+for bin in "$busybox" "$fio"; do
+        if [ ! -x "$bin" ]; then
+                echo "missing static binary '$bin', set BUSYBOX= and FIO=" >&2
+                exit 1
+        fi
+done
+
+rm -rf "$root"
+mkdir -p "$root/bin" "$root/dev" "$root/proc" "$root/sys" "$root/tmp" \
+        "$root/bench" "$root/modules" "$root/lib"
+
+cp "$busybox" "$root/bin/busybox"
+cp "$fio" "$root/bin/fio"
+for cmd in sh mount modprobe insmod rmmod mkdir cat dd date echo sleep poweroff ls grep readlink; do
+        ln -s busybox "$root/bin/$cmd"
+done
+
+cp -r "$kdir/staging/lib/modules" "$root/lib/"
+find "$out/src" -name '*.ko' -exec cp {} "$root/modules/" \;
+
+cp "$here/guest/init" "$root/init"
+cp "$here/guest/lib.sh" "$root/bench/"
+cp "$here"/fio/*.fio "$root/bench/"
+for suite in $suites; do
+        cp "$here/guest/$suite.sh" "$root/bench/"
+done
+echo "$suites" > "$root/bench/suites"
+
+(cd "$root" && find . | cpio -o -H newc --quiet) | gzip -9 > "$out/initramfs.cpio.gz"
@@ -0,0 +1,39 @@
+#!/bin/sh
+# build-kernel.sh <version> <build dir> <jobs>
+#
+# Fetches the pinned kernel release, checks it against the checksum
+# listed in sha256sums.asc next to it and builds a bzImage plus the
+# in-tree modules (dummy_hcd, gadgets) with config/bench.config.
+#
+# The signature on sha256sums.asc is not verified, the checksum only
+# catches a corrupt download, not a tampered mirror.
+set -e
+
+version=$1
+build=$2
+jobs=${3:-1}
+here=$(cd "$(dirname "$0")/.." && pwd)
+major=$(echo "$version" | cut -d. -f1)
+mirror=https://cdn.kernel.org/pub/linux/kernel/v$major.x
+tarball=linux-$version.tar.xz
+src=$build/linux-$version
+
+mkdir -p "$build"
+cd "$build"
+
+if [ ! -f "$tarball" ]; then
+        wget -q "$mirror/$tarball" -O "$tarball.part"
+        mv "$tarball.part" "$tarball"
+fi
+wget -q "$mirror/sha256sums.asc" -O sha256sums-v$major.asc
+grep " $tarball\$" sha256sums-v$major.asc | sha256sum -c -
+
+rm -rf "$src"
+tar -xf "$tarball"
+cd "$src"
+
+make defconfig
+scripts/kconfig/merge_config.sh -m .config "$here/config/bench.config"
+make olddefconfig
+make -j"$jobs" bzImage modules
+make modules_install INSTALL_MOD_PATH="$src/staging"
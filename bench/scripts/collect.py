@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""Turn a guest console log into results json, or merge result files.
+
+    collect.py <console.log>
+    collect.py --merge <results.json>...
+
+Results map "<suite>/<job>" to a dict of metrics. fio jobs report
+iops, bandwidth in KiB/s and completion latency percentiles in usec.
+"""
+
+import json
+import re
+import sys
+
+BEGIN = re.compile(r"^@@BENCH-BEGIN (\S+)@@$")
+END = "@@BENCH-END@@"
+RESULT = re.compile(r"^@@BENCH-RESULT (\S+) (\S+) (\S+)@@$")
+FAIL = re.compile(r"^@@BENCH-FAIL (\S+)@@$")
+
+
+def fio_metrics(report):
+    metrics = {}
+    for job in report["jobs"]:
+        name = job["jobname"]
+        out = metrics.setdefault(name, {})
+        for ddir in ("read", "write"):
+            stats = job[ddir]
+            if stats["io_bytes"] == 0:
+                continue
+            out[ddir + "_iops"] = stats["iops"]
+            out[ddir + "_bw_kib"] = stats["bw"]
+            clat = stats.get("clat_ns") or stats.get("clat")
+            scale = 1000.0 if "clat_ns" in stats else 1.0
+            pct = clat.get("percentile", {})
+            for key, label in (("50.000000", "p50"), ("99.000000", "p99")):
+                if key in pct:
+                    out["%s_clat_%s_us" % (ddir, label)] = pct[key] / scale
+    return metrics
+
+
+def parse_log(path):
+    results = {}
+    failed = []
+    block = None
+    suite = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.rstrip("\r\n")
+            if block is not None:
+                if line == END:
+                    text = "\n".join(block)
+                    report = json.loads(text[text.index("{"):])
+                    for job, metrics in fio_metrics(report).items():
+                        results["%s/%s" % (suite, job)] = metrics
+                    block = None
+                else:
+                    block.append(line)
+                continue
+            m = BEGIN.match(line)
+            if m:
+                suite = m.group(1)
+                block = []
+                continue
+            m = RESULT.match(line)
+            if m:
+                name, metric, value = m.groups()
+                results.setdefault(name, {})[metric] = float(value)
+                continue
+            m = FAIL.match(line)
+            if m:
+                failed.append(m.group(1))
+    if failed:
+        sys.exit("suites failed: " + ", ".join(failed))
+    return results
+
+
+def main(argv):
+    if len(argv) > 1 and argv[1] == "--merge":
+        results = {}
+        for path in argv[2:]:
+            with open(path) as f:
+                results.update(json.load(f))
+    elif len(argv) == 2:
+        results = parse_log(argv[1])
+    else:
+        sys.exit(__doc__)
+    json.dump(results, sys.stdout, indent=2, sort_keys=True)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main(sys.argv)
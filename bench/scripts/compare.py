@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""Compare benchmark results with a stored baseline.
+
+    compare.py [--tolerance <percent>] <baseline.json> <results.json>
+
+Latency metrics (*_us) regress when they grow, everything else when it
+shrinks, by more than the tolerance. Exits 1 on any regression. Without
+a baseline the results are only printed, see "make baseline".
+"""
+
+import argparse
+import json
+import os
+import sys
+
+
+def lower_is_better(metric):
+    return metric.endswith("_us")
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--tolerance", type=float, default=10.0)
+    parser.add_argument("baseline")
+    parser.add_argument("results")
+    args = parser.parse_args()
+
+    with open(args.results) as f:
+        results = json.load(f)
+    if not os.path.exists(args.baseline):
+        print("no baseline, run 'make baseline' to store these results")
+        json.dump(results, sys.stdout, indent=2, sort_keys=True)
+        print()
+        return 0
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+
+    regressions = 0
+    for name in sorted(set(baseline) | set(results)):
+        if name not in results:
+            print("%-40s missing from results" % name)
+            regressions += 1
+            continue
+        if name not in baseline:
+            print("%-40s new" % name)
+            continue
+        for metric, old in sorted(baseline[name].items()):
+            new = results[name].get(metric)
+            if new is None:
+                print("%-40s %-24s missing" % (name, metric))
+                regressions += 1
+                continue
+            change = (new - old) * 100.0 / old if old else 0.0
+            worse = change > args.tolerance if lower_is_better(metric) \
+                else change < -args.tolerance
+            print("%-40s %-24s %14.1f -> %14.1f %+7.1f%%%s" % (
+                name, metric, old, new, change, "  REGRESSION" if worse else ""))
+            regressions += worse
+
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,20 @@
+#!/bin/sh
+# run-qemu.sh <bzImage> <initramfs> <console log>
+#
+# Boots the guest without network on a fixed cpu and memory layout so
+# runs stay comparable, the guest powers off after the last suite.
+set -e
+
+kernel=$1
+initrd=$2
+log=$3
+
+qemu-system-x86_64 \
+        -machine q35 -cpu max -smp 4 -m 2048 \
+        ${QEMU_ACCEL:--accel kvm} \
+        -nic none -no-reboot -nographic \
+        -kernel "$kernel" -initrd "$initrd" \
+        -append "console=ttyS0 panic=-1 quiet" \
+        < /dev/null | tee "$log"
+
+grep -q '^@@BENCH-DONE@@' "$log"
@@ -9,12 +9,54 @@
 #include <linux/genhd.h>
 #include <linux/blkdev.h>
 #include <linux/hdreg.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/highmem.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include <linux/list.h>
+
+#include "memdrive.h"
 
 #define KERNEL_SECTOR_SIZE 512
 
 static int memdrive_major;
 static int logical_block_size = 512;
 static int nsectors = 1024;
+module_param(nsectors, int, 0444);
+static bool zoned;
+module_param(zoned, bool, 0444);
+static int zone_sectors = 256;
+module_param(zone_sectors, int, 0444);
+static int zone_cap_sectors; // 0 means the whole zone
+module_param(zone_cap_sectors, int, 0444);
+static int nr_conv_zones = 1;
+module_param(nr_conv_zones, int, 0444);
+
+/*
+ * Simulation profile, all zero completes every request inline. The
+ * parameters are writable below /sys/module/memdrive/parameters and
+ * apply to requests issued after the change.
+ */
+static uint latency_us; // fixed completion latency
+module_param(latency_us, uint, 0644);
+static uint jitter_us; // uniformly distributed extra latency
+module_param(jitter_us, uint, 0644);
+static uint tail_permille; // share of requests hitting the tail latency
+module_param(tail_permille, uint, 0644);
+static uint tail_latency_us; // extra latency of a tail request
+module_param(tail_latency_us, uint, 0644);
+static uint qd_latency_us; // extra latency per request already in flight
+module_param(qd_latency_us, uint, 0644);
+static uint read_bw_kbs; // read bandwidth cap in KiB/s
+module_param(read_bw_kbs, uint, 0644);
+static uint write_bw_kbs; // write bandwidth cap in KiB/s
+module_param(write_bw_kbs, uint, 0644);
+static uint bw_burst_kb; // bucket depth, KiB that may move at once after idling
+module_param(bw_burst_kb, uint, 0644);
+static uint error_permille; // share of requests failed with -EIO
+module_param(error_permille, uint, 0644);
 
 static struct request_queue *memdrive_queue;
 
@@ -27,41 +69,455 @@ static struct memdrive_dev {
         struct request_queue *queue;
         struct gendisk *gd;
         struct timer_list timer;
+        struct memdrive_zone *zones; // NULL unless zoned
+        unsigned int nr_zones;
+        struct hrtimer completion_timer;
+        struct list_head inflight; // deferred requests by deadline
+        unsigned int nr_inflight;
+        bool dying; // complete inline, the timer is about to go away
+        ktime_t bw_next[2]; // token buckets, when the bytes moved so far are paid off
 } memdrive;
 
-static void memdrive_transfer(struct memdrive_dev *dev, sector_t sector, 
+// deferred completion of a request, see memdrive_defer()
+struct memdrive_cmd {
+        struct list_head node;
+        struct request *req;
+        ktime_t deadline;
+        int error;
+};
+
+static struct kmem_cache *memdrive_cmd_cache;
+
+static struct memdrive_zone *memdrive_zone(struct memdrive_dev *dev, sector_t sector)
+{
+        return &dev->zones[sector / zone_sectors];
+}
+
+// check a write against the write pointer and advance it, caller holds dev->lock
+static int memdrive_zone_write(struct memdrive_dev *dev, sector_t sector,
+        unsigned long nsect)
+{
+        struct memdrive_zone *zone = memdrive_zone(dev, sector);
+
+        if (zone->type == MEMDRIVE_ZONE_TYPE_CONVENTIONAL)
+                return sector + nsect <= zone->start + zone->len ? 0 : -EIO;
+
+        if (zone->cond == MEMDRIVE_ZONE_COND_FULL || sector != zone->wp ||
+                sector + nsect > zone->start + zone->capacity) {
+                pr_notice("memdrive: unaligned zone write (%llu %lu, wp %llu)\n",
+                        (unsigned long long)sector, nsect, zone->wp);
+                return -EIO;
+        }
+
+        zone->wp += nsect;
+        if (zone->wp == zone->start + zone->capacity)
+                zone->cond = MEMDRIVE_ZONE_COND_FULL;
+        else if (zone->cond != MEMDRIVE_ZONE_COND_EXP_OPEN)
+                zone->cond = MEMDRIVE_ZONE_COND_IMP_OPEN;
+        return 0;
+}
+
+// copy out what was written, zeros above the write pointers
+static void memdrive_zone_read(struct memdrive_dev *dev, sector_t sector,
+        unsigned long nsect, char *buffer)
+{
+        while (nsect) {
+                struct memdrive_zone *zone = memdrive_zone(dev, sector);
+                unsigned long n = min_t(u64, nsect, zone->start + zone->len - sector);
+                unsigned long valid = n;
+
+                if (zone->type != MEMDRIVE_ZONE_TYPE_CONVENTIONAL)
+                        valid = zone->wp > sector ? min_t(u64, n, zone->wp - sector) : 0;
+
+                memcpy(buffer, dev->data + sector * KERNEL_SECTOR_SIZE,
+                        valid * KERNEL_SECTOR_SIZE);
+                memset(buffer + valid * KERNEL_SECTOR_SIZE, 0,
+                        (n - valid) * KERNEL_SECTOR_SIZE);
+
+                sector += n;
+                nsect -= n;
+                buffer += n * KERNEL_SECTOR_SIZE;
+        }
+}
+
+static int memdrive_transfer(struct memdrive_dev *dev, sector_t sector,
         unsigned long nsect, char *buffer, int write) {
         unsigned long offset = sector * logical_block_size;
         unsigned long nbytes = nsect * logical_block_size;
 
         if ((offset + nbytes) > dev->size) {
                 pr_notice("memdrive: beyond-end write (%ld %ld)\n", offset, nbytes);
-                return;
+                return -EIO;
+        }
+
+        if (dev->zones && !write) {
+                memdrive_zone_read(dev, sector, nsect, buffer);
+                return 0;
         }
+        if (dev->zones && memdrive_zone_write(dev, sector, nsect))
+                return -EIO;
 
         if (write) {
                 memcpy(dev->data + offset, buffer, nbytes);
         } else {
                 memcpy(buffer, dev->data + offset, nbytes);
         }
+        return 0;
+}
+
+static int memdrive_transfer_request(struct memdrive_dev *dev, struct request *req) {
+        struct bio_vec *bvec;
+        struct req_iterator iter;
+        sector_t sector = blk_rq_pos(req);
+        char *buffer;
+        int err = 0;
+
+        rq_for_each_segment(bvec, req, iter) {
+                buffer = kmap_atomic(bvec->bv_page);
+                err = memdrive_transfer(dev, sector, bvec->bv_len / KERNEL_SECTOR_SIZE,
+                        buffer + bvec->bv_offset, rq_data_dir(req));
+                kunmap_atomic(buffer);
+                if (err)
+                        break;
+                sector += bvec->bv_len / KERNEL_SECTOR_SIZE;
+        }
+        return err;
+}
+
+static bool memdrive_chance(unsigned int permille) {
+        return permille && prandom_u32() % 1000 < permille;
+}
+
+static bool memdrive_deferred(void) {
+        return latency_us || jitter_us || tail_permille || qd_latency_us ||
+                read_bw_kbs || write_bw_kbs;
+}
+
+// completion time of req under the current profile, caller holds dev->lock
+static ktime_t memdrive_deadline(struct memdrive_dev *dev, struct request *req) {
+        int dir = rq_data_dir(req);
+        unsigned int bw = dir ? write_bw_kbs : read_bw_kbs;
+        ktime_t now = ktime_get();
+        ktime_t start = now;
+        u64 delay_ns;
+
+        /*
+         * bandwidth: every direction owns a bucket that refills at bw and
+         * holds bw_burst_kb. Tokens saved while idle are bw_next lagging
+         * behind now, capped at the bucket depth. A depth of 0 paces
+         * every request at exactly bw.
+         */
+        if (bw) {
+                ktime_t full = ktime_sub_ns(now, div_u64((u64)bw_burst_kb *
+                        NSEC_PER_SEC, bw));
+                ktime_t next = dev->bw_next[dir];
+
+                if (ktime_compare(next, full) < 0)
+                        next = full;
+                next = ktime_add_ns(next, div_u64((u64)blk_rq_bytes(req) *
+                        NSEC_PER_SEC, bw * 1024ULL));
+                dev->bw_next[dir] = next;
+                if (ktime_compare(next, now) > 0)
+                        start = next;
+        }
+
+        // latency: fixed + uniform jitter + bimodal tail + queue depth
+        delay_ns = (u64)latency_us * NSEC_PER_USEC;
+        if (jitter_us)
+                delay_ns += (u64)(prandom_u32() % jitter_us) * NSEC_PER_USEC;
+        if (memdrive_chance(tail_permille))
+                delay_ns += (u64)tail_latency_us * NSEC_PER_USEC;
+        delay_ns += (u64)dev->nr_inflight * qd_latency_us * NSEC_PER_USEC;
+
+        return ktime_add_ns(start, delay_ns);
+}
+
+// park req until its deadline, caller holds dev->lock
+static void memdrive_defer(struct memdrive_dev *dev, struct request *req, int err) {
+        struct memdrive_cmd *cmd, *pos;
+
+        cmd = kmem_cache_alloc(memdrive_cmd_cache, GFP_ATOMIC);
+        if (!cmd) {
+                __blk_end_request_all(req, err);
+                return;
+        }
+        cmd->req = req;
+        cmd->error = err;
+        cmd->deadline = memdrive_deadline(dev, req);
+
+        // keep the list sorted, jitter can reorder completions
+        list_for_each_entry_reverse(pos, &dev->inflight, node) {
+                if (ktime_compare(pos->deadline, cmd->deadline) <= 0)
+                        break;
+        }
+        list_add(&cmd->node, &pos->node);
+        dev->nr_inflight++;
+
+        if (dev->inflight.next == &cmd->node)
+                hrtimer_start(&dev->completion_timer, cmd->deadline, HRTIMER_MODE_ABS);
+}
+
+// complete deferred requests up to limit, caller holds dev->lock
+static void memdrive_complete(struct memdrive_dev *dev, ktime_t limit) {
+        struct memdrive_cmd *cmd, *tmp;
+
+        list_for_each_entry_safe(cmd, tmp, &dev->inflight, node) {
+                if (ktime_compare(cmd->deadline, limit) > 0)
+                        break;
+                list_del(&cmd->node);
+                dev->nr_inflight--;
+                __blk_end_request_all(cmd->req, cmd->error);
+                kmem_cache_free(memdrive_cmd_cache, cmd);
+        }
+}
+
+static enum hrtimer_restart memdrive_timer(struct hrtimer *timer) {
+        struct memdrive_dev *dev = container_of(timer, struct memdrive_dev, completion_timer);
+        struct memdrive_cmd *next;
+        enum hrtimer_restart ret = HRTIMER_NORESTART;
+        unsigned long flags;
+
+        spin_lock_irqsave(&dev->lock, flags);
+        memdrive_complete(dev, ktime_get());
+        // memdrive_defer() may have re-armed us for an earlier request already
+        if (!list_empty(&dev->inflight) && !hrtimer_is_queued(timer)) {
+                next = list_first_entry(&dev->inflight, struct memdrive_cmd, node);
+                hrtimer_set_expires(timer, next->deadline);
+                ret = HRTIMER_RESTART;
+        }
+        spin_unlock_irqrestore(&dev->lock, flags);
+        return ret;
 }
 
 static void memdrive_request(struct request_queue *q) {
         struct request *req;
+        int err;
 
         req = blk_fetch_request(q);
         while(req != NULL) {
                 if (req == NULL || (req->cmd_type != REQ_TYPE_FS)) {
                         pr_notice("memdrive: skip non-cmd request\n");
                         __blk_end_request_all(req, -EIO);
+                        req = blk_fetch_request(q);
                         continue;
                 } 
-                memdrive_transfer(&memdrive, blk_rq_pos(req), 
-                        blk_rq_cur_sectors(req), req->buffer, rq_data_dir(req));
-                if (!__blk_end_request_cur(req, 0)) {
-                        req = blk_fetch_request(q);
+                if (memdrive_chance(error_permille))
+                        err = -EIO;
+                else
+                        err = memdrive_transfer_request(&memdrive, req);
+
+                if (memdrive_deferred() && !memdrive.dying)
+                        memdrive_defer(&memdrive, req, err);
+                else
+                        __blk_end_request_all(req, err);
+                req = blk_fetch_request(q);
+        }
+}
+
+static int memdrive_report_zones(struct memdrive_dev *dev,
+        struct memdrive_zone_report __user *argp)
+{
+        struct memdrive_zone_report rep;
+        struct memdrive_zone *zones;
+        unsigned int first, n;
+
+        if (copy_from_user(&rep, argp, sizeof(rep)))
+                return -EFAULT;
+        if (rep.sector >= (u64)dev->nr_zones * zone_sectors)
+                return -EINVAL;
+
+        first = rep.sector / zone_sectors;
+        n = min(rep.nr_zones, dev->nr_zones - first);
+        zones = kmalloc_array(n, sizeof(*zones), GFP_KERNEL);
+        if (!zones && n)
+                return -ENOMEM;
+
+        // snapshot under the lock, copy to userspace without it
+        spin_lock_irq(&dev->lock);
+        memcpy(zones, &dev->zones[first], n * sizeof(*zones));
+        spin_unlock_irq(&dev->lock);
+
+        rep.nr_zones = n;
+        if (copy_to_user((void __user *)(unsigned long)rep.zones, zones,
+                n * sizeof(*zones)) || copy_to_user(argp, &rep, sizeof(rep))) {
+                kfree(zones);
+                return -EFAULT;
+        }
+        kfree(zones);
+        return 0;
+}
+
+static int memdrive_zone_mgmt(struct memdrive_dev *dev, unsigned int cmd,
+        struct memdrive_zone_range __user *argp)
+{
+        struct memdrive_zone_range range;
+        struct memdrive_zone *zone;
+        int err = 0;
+
+        if (copy_from_user(&range, argp, sizeof(range)))
+                return -EFAULT;
+        if (range.sector >= (u64)dev->nr_zones * zone_sectors ||
+                range.sector % zone_sectors)
+                return -EINVAL;
+
+        spin_lock_irq(&dev->lock);
+        zone = memdrive_zone(dev, range.sector);
+        if (zone->type == MEMDRIVE_ZONE_TYPE_CONVENTIONAL) {
+                err = -EINVAL;
+                goto out;
+        }
+
+        switch (cmd) {
+        case MEMDRIVE_IOC_RESET_ZONE:
+                // data above the write pointer reads as zeros, no memset needed
+                zone->wp = zone->start;
+                zone->cond = MEMDRIVE_ZONE_COND_EMPTY;
+                break;
+        case MEMDRIVE_IOC_OPEN_ZONE:
+                if (zone->cond != MEMDRIVE_ZONE_COND_FULL)
+                        zone->cond = MEMDRIVE_ZONE_COND_EXP_OPEN;
+                break;
+        case MEMDRIVE_IOC_CLOSE_ZONE:
+                if (zone->cond == MEMDRIVE_ZONE_COND_IMP_OPEN ||
+                        zone->cond == MEMDRIVE_ZONE_COND_EXP_OPEN)
+                        zone->cond = zone->wp == zone->start ?
+                                MEMDRIVE_ZONE_COND_EMPTY : MEMDRIVE_ZONE_COND_CLOSED;
+                break;
+        case MEMDRIVE_IOC_FINISH_ZONE:
+                // the skipped range reads as zeros, not as data from before a reset
+                memset(dev->data + zone->wp * KERNEL_SECTOR_SIZE, 0,
+                        (zone->start + zone->capacity - zone->wp) * KERNEL_SECTOR_SIZE);
+                zone->wp = zone->start + zone->capacity;
+                zone->cond = MEMDRIVE_ZONE_COND_FULL;
+                break;
+        }
+out:
+        spin_unlock_irq(&dev->lock);
+        return err;
+}
+
+static int memdrive_zone_append(struct memdrive_dev *dev,
+        struct memdrive_zone_append __user *argp)
+{
+        struct memdrive_zone_append app;
+        struct memdrive_zone *zone;
+        size_t nbytes;
+        char *buffer;
+        int err;
+
+        if (copy_from_user(&app, argp, sizeof(app)))
+                return -EFAULT;
+        if (app.sector >= (u64)dev->nr_zones * zone_sectors ||
+                app.nr_sectors == 0 || app.nr_sectors > MEMDRIVE_APPEND_MAX)
+                return -EINVAL;
+
+        // the request lock is a spinlock, fetch the data beforehand
+        nbytes = app.nr_sectors * KERNEL_SECTOR_SIZE;
+        buffer = kmalloc(nbytes, GFP_KERNEL);
+        if (!buffer)
+                return -ENOMEM;
+        if (copy_from_user(buffer, (void __user *)(unsigned long)app.buf, nbytes)) {
+                kfree(buffer);
+                return -EFAULT;
+        }
+
+        spin_lock_irq(&dev->lock);
+        zone = memdrive_zone(dev, app.sector);
+        if (zone->type == MEMDRIVE_ZONE_TYPE_CONVENTIONAL) {
+                err = -EINVAL;
+        } else {
+                app.written = zone->wp;
+                err = memdrive_zone_write(dev, zone->wp, app.nr_sectors);
+                if (!err)
+                        memcpy(dev->data + app.written * KERNEL_SECTOR_SIZE, buffer, nbytes);
+        }
+        spin_unlock_irq(&dev->lock);
+        kfree(buffer);
+
+        if (err)
+                return err;
+        if (copy_to_user(&argp->written, &app.written, sizeof(app.written)))
+                return -EFAULT;
+        return 0;
+}
+
+static int memdrive_ioctl(struct block_device *bdev, fmode_t mode,
+        unsigned int cmd, unsigned long arg)
+{
+        struct memdrive_dev *dev = bdev->bd_disk->private_data;
+        void __user *argp = (void __user *)arg;
+        int err;
+
+        if (!dev->zones)
+                return -ENOTTY;
+
+        switch (cmd) {
+        case MEMDRIVE_IOC_REPORT_ZONES:
+                return memdrive_report_zones(dev, argp);
+        case MEMDRIVE_IOC_OPEN_ZONE:
+        case MEMDRIVE_IOC_CLOSE_ZONE:
+                if (!(mode & FMODE_WRITE))
+                        return -EBADF;
+                return memdrive_zone_mgmt(dev, cmd, argp);
+        case MEMDRIVE_IOC_RESET_ZONE:
+        case MEMDRIVE_IOC_FINISH_ZONE:
+                if (!(mode & FMODE_WRITE))
+                        return -EBADF;
+                err = memdrive_zone_mgmt(dev, cmd, argp);
+                break;
+        case MEMDRIVE_IOC_ZONE_APPEND:
+                if (!(mode & FMODE_WRITE))
+                        return -EBADF;
+                err = memdrive_zone_append(dev, argp);
+                break;
+        default:
+                return -ENOTTY;
+        }
+
+        // the data changed behind the page cache, drop what it holds
+        if (!err)
+                invalidate_bdev(bdev);
+        return err;
+}
+
+static int memdrive_init_zones(struct memdrive_dev *dev)
+{
+        unsigned int i;
+        int cap = zone_cap_sectors ? zone_cap_sectors : zone_sectors;
+
+        // a page sized segment must never straddle two zones
+        if (zone_sectors <= 0 || zone_sectors % (PAGE_SIZE / KERNEL_SECTOR_SIZE) ||
+                nsectors % zone_sectors || cap <= 0 || cap > zone_sectors)
+                return -EINVAL;
+
+        dev->nr_zones = nsectors / zone_sectors;
+        if (nr_conv_zones < 0 || nr_conv_zones > dev->nr_zones)
+                return -EINVAL;
+
+        dev->zones = kcalloc(dev->nr_zones, sizeof(*dev->zones), GFP_KERNEL);
+        if (!dev->zones)
+                return -ENOMEM;
+
+        for (i = 0; i < dev->nr_zones; i++) {
+                struct memdrive_zone *zone = &dev->zones[i];
+
+                zone->start = (u64)i * zone_sectors;
+                zone->len = zone_sectors;
+                if (i < nr_conv_zones) {
+                        zone->type = MEMDRIVE_ZONE_TYPE_CONVENTIONAL;
+                        zone->cond = MEMDRIVE_ZONE_COND_NOT_WP;
+                        zone->capacity = zone_sectors;
+                        zone->wp = ~0ULL;
+                } else {
+                        zone->type = MEMDRIVE_ZONE_TYPE_SEQWRITE_REQ;
+                        zone->cond = MEMDRIVE_ZONE_COND_EMPTY;
+                        zone->capacity = cap;
+                        zone->wp = zone->start;
                 }
         }
+        pr_info("memdrive: %u zones of %d sectors, %d conventional",
+                dev->nr_zones, zone_sectors, nr_conv_zones);
+        return 0;
 }
 
 static int memdrive_getgeo(struct block_device *block_device, struct hd_geometry *geo)
@@ -77,18 +533,38 @@ static int memdrive_getgeo(struct block_device *block_device, struct hd_geometry
 
 static struct block_device_operations memdrive_fops = {
         .owner = THIS_MODULE,
-        .getgeo = memdrive_getgeo
+        .getgeo = memdrive_getgeo,
+        .ioctl = memdrive_ioctl
 };
 
 static int __init memdrive_init (void)
 {
+        int retval = -ENOMEM;
+
         pr_info("memdrive: start loading");
+        // size is an int, the bounds check in memdrive_transfer() relies on it
+        if (nsectors <= 0 || nsectors > INT_MAX / logical_block_size)
+                return -EINVAL;
         memdrive.size = nsectors * logical_block_size;
         spin_lock_init(&memdrive.lock);
         memdrive.data = vmalloc(memdrive.size);
         if (!memdrive.data)
                 return -ENOMEM;
 
+        if (zoned) {
+                retval = memdrive_init_zones(&memdrive);
+                if (retval < 0)
+                        goto fail1;
+                retval = -ENOMEM;
+        }
+
+        INIT_LIST_HEAD(&memdrive.inflight);
+        hrtimer_init(&memdrive.completion_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+        memdrive.completion_timer.function = memdrive_timer;
+        memdrive_cmd_cache = KMEM_CACHE(memdrive_cmd, 0);
+        if (!memdrive_cmd_cache)
+                goto fail1;
+
         memdrive_queue = blk_init_queue(memdrive_request, &memdrive.lock);
         if (!memdrive_queue)
                 goto fail1;
@@ -117,8 +593,11 @@ static int __init memdrive_init (void)
 fail2:
         unregister_blkdev(memdrive_major, "memdrive");
 fail1:
+        if (memdrive_cmd_cache)
+                kmem_cache_destroy(memdrive_cmd_cache);
+        kfree(memdrive.zones);
         vfree(memdrive.data);
-        return -ENOMEM;
+        return retval;
 }
 
 static void __exit memdrive_release (void)
@@ -126,7 +605,18 @@ static void __exit memdrive_release (void)
         del_gendisk(memdrive.gd);
         put_disk(memdrive.gd);
         unregister_blkdev(memdrive_major, "memdrive");
+
+        // stop parking requests and finish the parked ones, so draining
+        // the queue never waits for the timer
+        spin_lock_irq(&memdrive.lock);
+        memdrive.dying = true;
+        memdrive_complete(&memdrive, ktime_set(KTIME_SEC_MAX, 0));
+        spin_unlock_irq(&memdrive.lock);
+
         blk_cleanup_queue(memdrive_queue);
+        hrtimer_cancel(&memdrive.completion_timer);
+        kmem_cache_destroy(memdrive_cmd_cache);
+        kfree(memdrive.zones);
         vfree(memdrive.data);
 }
 
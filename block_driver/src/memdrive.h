@@ -0,0 +1,76 @@
+#ifndef MEMDRIVE_H
+#define MEMDRIVE_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Zoned mode of memdrive (module parameter zoned=1). The disk is split
+ * into zones of zone_sectors 512 byte sectors, a multiple of the page
+ * size. The first nr_conv_zones are conventional, the rest sequential
+ * write required with a writable capacity of zone_cap_sectors. Writes
+ * to a sequential zone must start at its write pointer, reads above the
+ * write pointer return zeros.
+ *
+ * Reset, finish and append change the data behind the page cache, the
+ * driver drops clean cached pages afterwards. Dirty pages of buffered
+ * writes are not dropped, use O_DIRECT or fsync() before these ioctls.
+ */
+
+enum memdrive_zone_type {
+        MEMDRIVE_ZONE_TYPE_CONVENTIONAL = 1,
+        MEMDRIVE_ZONE_TYPE_SEQWRITE_REQ = 2,
+};
+
+enum memdrive_zone_cond {
+        MEMDRIVE_ZONE_COND_NOT_WP = 0,
+        MEMDRIVE_ZONE_COND_EMPTY = 1,
+        MEMDRIVE_ZONE_COND_IMP_OPEN = 2,
+        MEMDRIVE_ZONE_COND_EXP_OPEN = 3,
+        MEMDRIVE_ZONE_COND_CLOSED = 4,
+        MEMDRIVE_ZONE_COND_FULL = 14,
+};
+
+struct memdrive_zone {
+        __u64 start;    // first sector of the zone
+        __u64 len;      // zone size in sectors
+        __u64 capacity; // writable sectors
+        __u64 wp;       // write pointer
+        __u8 type;
+        __u8 cond;
+        __u8 reserved[6];
+};
+
+// report zones starting with the one containing sector into zones
+struct memdrive_zone_report {
+        __u64 sector;
+        __u64 zones;    // user pointer to struct memdrive_zone[nr_zones]
+        __u32 nr_zones; // in: array size, out: zones reported
+        __u32 reserved;
+};
+
+// zone start sector for reset/open/close/finish
+struct memdrive_zone_range {
+        __u64 sector;
+};
+
+// append nr_sectors from buf at the write pointer of the zone at sector
+struct memdrive_zone_append {
+        __u64 sector;
+        __u64 buf;
+        __u32 nr_sectors;
+        __u32 reserved;
+        __u64 written;  // out: sector the data landed on
+};
+
+#define MEMDRIVE_APPEND_MAX 256 // sectors per append
+
+#define MEMDRIVE_IOC_MAGIC 'M'
+#define MEMDRIVE_IOC_REPORT_ZONES _IOWR(MEMDRIVE_IOC_MAGIC, 1, struct memdrive_zone_report)
+#define MEMDRIVE_IOC_RESET_ZONE _IOW(MEMDRIVE_IOC_MAGIC, 2, struct memdrive_zone_range)
+#define MEMDRIVE_IOC_OPEN_ZONE _IOW(MEMDRIVE_IOC_MAGIC, 3, struct memdrive_zone_range)
+#define MEMDRIVE_IOC_CLOSE_ZONE _IOW(MEMDRIVE_IOC_MAGIC, 4, struct memdrive_zone_range)
+#define MEMDRIVE_IOC_FINISH_ZONE _IOW(MEMDRIVE_IOC_MAGIC, 5, struct memdrive_zone_range)
+#define MEMDRIVE_IOC_ZONE_APPEND _IOWR(MEMDRIVE_IOC_MAGIC, 6, struct memdrive_zone_append)
+
+#endif
@@ -2,56 +2,568 @@
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/types.h>
 #include <linux/kdev_t.h>
 #include <linux/fs.h>
 #include <linux/device.h>
 #include <linux/cdev.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/cache.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
 
-#define STORE_SIZE 10
+#include "mychar.h"
+
+#define MAX_DEVICES 64
+
+static int ndevices = 4; // number of minors, each with its own ring
+module_param(ndevices, int, 0444);
+static int ring_order = 4; // data area is PAGE_SIZE << ring_order bytes
+module_param(ring_order, int, 0444);
+static uint rx_watermark = 1; // bytes queued before readers are woken
+module_param(rx_watermark, uint, 0444);
+static uint tx_watermark = 1; // bytes free before writers are woken
+module_param(tx_watermark, uint, 0444);
+
+/*
+ * Per minor context. Producer and consumer state sit on separate cache
+ * lines so a writer and a reader on different cores don't bounce them.
+ */
+struct my_dev {
+        struct cdev c_dev; // char device structure
+        dev_t devt;
+        struct mychar_ring *ring; // header page followed by the data area
+        u8 *ring_data;
+        u32 ring_mask; // private, the header is writable through mmap
+        u32 head; // private copy of ring->head, only the driver writes it
+        u32 rx_wm, tx_wm; // current watermarks, see MYCHAR_IOC_SET_WATERMARKS
+        atomic_t rx_short, tx_short; // sleepers asking for less than the watermark
+        struct fasync_struct *async_queue;
+
+        struct mutex write_lock ____cacheline_aligned_in_smp; // serializes producers
+        wait_queue_head_t write_wait;
+
+        struct mutex read_lock ____cacheline_aligned_in_smp; // serializes read() consumers
+        wait_queue_head_t read_wait;
+};
 
 static dev_t first; // device number
-static struct cdev c_dev; // char device structure
 static struct class *cl; // device class
-static char store[STORE_SIZE];
+static struct kmem_cache *dev_cache;
+static struct my_dev *devs[MAX_DEVICES];
+
+/*
+ * The header page is mapped writable, so apart from tail the driver
+ * never reads it back: size and head come from the private copies in
+ * struct my_dev and tail is range checked before use.
+ */
+static u32 ring_size(struct my_dev *dev)
+{
+        return dev->ring_mask + 1;
+}
+
+static u32 ring_used(struct my_dev *dev)
+{
+        u32 used = smp_load_acquire(&dev->head) - smp_load_acquire(&dev->ring->tail);
+
+        return min(used, ring_size(dev));
+}
+
+static u32 ring_free(struct my_dev *dev)
+{
+        return ring_size(dev) - ring_used(dev);
+}
+
+// make new data visible to read() and to mmap consumers
+static void ring_publish_head(struct my_dev *dev, u32 head)
+{
+        smp_store_release(&dev->head, head);
+        smp_store_release(&dev->ring->head, head);
+}
+
+static bool ring_readable(struct my_dev *dev)
+{
+        return ring_used(dev) >= READ_ONCE(dev->rx_wm);
+}
+
+static bool ring_writable(struct my_dev *dev)
+{
+        return ring_free(dev) >= READ_ONCE(dev->tx_wm);
+}
+
+// like sock_rcvlowat(), a transfer never waits for more than it asked for
+static bool ring_readable_for(struct my_dev *dev, size_t len)
+{
+        return ring_used(dev) >= min_t(size_t, READ_ONCE(dev->rx_wm), len);
+}
+
+static bool ring_writable_for(struct my_dev *dev, size_t len)
+{
+        return ring_free(dev) >= min_t(size_t, READ_ONCE(dev->tx_wm), len);
+}
+
+/*
+ * Wake readers once the fill level reached the rx watermark, or as soon
+ * as there is any data while a reader sleeps on a request shorter than
+ * the watermark. Those re-check their own threshold.
+ */
+static void wake_readers(struct my_dev *dev)
+{
+        bool reached = ring_readable(dev);
+
+        // pairs with the barrier in prepare_to_wait() of a sleeping reader
+        smp_mb();
+        if (!reached && !(atomic_read(&dev->rx_short) && ring_used(dev)))
+                return;
+        if (waitqueue_active(&dev->read_wait))
+                wake_up_interruptible(&dev->read_wait);
+        if (reached)
+                kill_fasync(&dev->async_queue, SIGIO, POLL_IN);
+}
+
+// wake writers once the free space reached the tx watermark, see above
+static void wake_writers(struct my_dev *dev)
+{
+        bool reached = ring_writable(dev);
+
+        smp_mb();
+        if (!reached && !(atomic_read(&dev->tx_short) && ring_free(dev)))
+                return;
+        if (waitqueue_active(&dev->write_wait))
+                wake_up_interruptible(&dev->write_wait);
+        if (reached)
+                kill_fasync(&dev->async_queue, SIGIO, POLL_OUT);
+}
+
+// sleep until a read of len bytes can make progress
+static int wait_readable(struct my_dev *dev, size_t len)
+{
+        bool is_short = len < READ_ONCE(dev->rx_wm);
+        int ret;
+
+        if (is_short)
+                atomic_inc(&dev->rx_short);
+        ret = wait_event_interruptible(dev->read_wait, ring_readable_for(dev, len));
+        if (is_short)
+                atomic_dec(&dev->rx_short);
+        return ret;
+}
+
+// sleep until a write of len bytes can make progress
+static int wait_writable(struct my_dev *dev, size_t len)
+{
+        bool is_short = len < READ_ONCE(dev->tx_wm);
+        int ret;
+
+        if (is_short)
+                atomic_inc(&dev->tx_short);
+        ret = wait_event_interruptible(dev->write_wait, ring_writable_for(dev, len));
+        if (is_short)
+                atomic_dec(&dev->tx_short);
+        return ret;
+}
+
+// copy n bytes from the iterator to ring position head, returns bytes copied
+static size_t ring_copy_in(struct my_dev *dev, u32 head, u32 n, struct iov_iter *from)
+{
+        u32 pos = head & dev->ring_mask;
+        u32 chunk = min(n, ring_size(dev) - pos);
+        size_t copied;
+
+        copied = copy_from_iter(dev->ring_data + pos, chunk, from);
+        if (copied == chunk && n > chunk)
+                copied += copy_from_iter(dev->ring_data, n - chunk, from);
+        return copied;
+}
+
+// copy n bytes from ring position tail to the iterator, returns bytes copied
+static size_t ring_copy_out(struct my_dev *dev, u32 tail, u32 n, struct iov_iter *to)
+{
+        u32 pos = tail & dev->ring_mask;
+        u32 chunk = min(n, ring_size(dev) - pos);
+        size_t copied;
+
+        copied = copy_to_iter(dev->ring_data + pos, chunk, to);
+        if (copied == chunk && n > chunk)
+                copied += copy_to_iter(dev->ring_data, n - chunk, to);
+        return copied;
+}
+
+// copy a kernel buffer to ring position head, the frame headers of batches
+static void ring_put(struct my_dev *dev, u32 head, const void *buf, u32 n)
+{
+        u32 pos = head & dev->ring_mask;
+        u32 chunk = min(n, ring_size(dev) - pos);
+
+        memcpy(dev->ring_data + pos, buf, chunk);
+        memcpy(dev->ring_data, buf + chunk, n - chunk);
+}
+
+// copy from ring position tail to a kernel buffer
+static void ring_get(struct my_dev *dev, u32 tail, void *buf, u32 n)
+{
+        u32 pos = tail & dev->ring_mask;
+        u32 chunk = min(n, ring_size(dev) - pos);
+
+        memcpy(buf, dev->ring_data + pos, chunk);
+        memcpy(buf + chunk, dev->ring_data, n - chunk);
+}
+
+// move as much of the iterator as fits into the ring, caller holds write_lock
+static ssize_t ring_produce(struct my_dev *dev, struct iov_iter *from)
+{
+        u32 head = dev->head;
+        u32 tail = smp_load_acquire(&dev->ring->tail);
+        u32 used = head - tail;
+        size_t copied;
+
+        // tail is writable by userspace, don't trust it
+        if (used > ring_size(dev))
+                return -EIO;
+
+        copied = ring_copy_in(dev, head,
+                min_t(size_t, iov_iter_count(from), ring_size(dev) - used), from);
+        if (copied == 0)
+                return -EFAULT;
+
+        // publish the data before the new head
+        ring_publish_head(dev, head + copied);
+        return copied;
+}
+
+// move as much of the ring as fits into the iterator, caller holds read_lock
+static ssize_t ring_consume(struct my_dev *dev, struct iov_iter *to)
+{
+        struct mychar_ring *ring = dev->ring;
+        u32 tail = READ_ONCE(ring->tail);
+        u32 head = smp_load_acquire(&dev->head);
+        u32 used = head - tail;
+        size_t copied;
+
+        if (used > ring_size(dev))
+                return -EIO;
+
+        copied = ring_copy_out(dev, tail,
+                min_t(size_t, iov_iter_count(to), used), to);
+        if (copied == 0)
+                return -EFAULT;
+
+        // hand the space back only after the data has been copied out
+        smp_store_release(&ring->tail, tail + copied);
+        return copied;
+}
+
+/*
+ * Enqueue records in order under a single write_lock acquisition, each
+ * behind a struct mychar_frame. A record goes in whole or not at all,
+ * the first one that doesn't fit stops the batch. head is published
+ * once at the end.
+ */
+static int ring_produce_batch(struct my_dev *dev, struct mychar_rec *recs, u32 count)
+{
+        u32 head = dev->head;
+        u32 tail = smp_load_acquire(&dev->ring->tail);
+        struct mychar_frame frame;
+        struct iovec iov;
+        struct iov_iter from;
+        u32 i;
+
+        if (head - tail > ring_size(dev))
+                return -EIO;
+
+        for (i = 0; i < count; i++) {
+                struct mychar_rec *rec = &recs[i];
+                u32 space = ring_size(dev) - (head - tail);
+
+                if (space < sizeof(frame) || rec->len > space - sizeof(frame)) {
+                        rec->status = -ENOSPC;
+                        break;
+                }
+                if (import_single_range(WRITE, u64_to_user_ptr(rec->addr),
+                        rec->len, &iov, &from) < 0) {
+                        rec->status = -EFAULT;
+                        break;
+                }
+                if (ring_copy_in(dev, head + sizeof(frame), rec->len, &from) != rec->len) {
+                        rec->status = -EFAULT;
+                        break;
+                }
+                frame.len = rec->len;
+                ring_put(dev, head, &frame, sizeof(frame));
+                head += sizeof(frame) + rec->len;
+                rec->status = rec->len;
+        }
+
+        ring_publish_head(dev, head);
+        return i;
+}
+
+/*
+ * Dequeue whole records in order under a single read_lock acquisition.
+ * A record whose buffer is too small fails with -EMSGSIZE and stays
+ * queued. The batch stops once the ring is empty, tail is published
+ * once at the end.
+ */
+static int ring_consume_batch(struct my_dev *dev, struct mychar_rec *recs, u32 count)
+{
+        struct mychar_ring *ring = dev->ring;
+        u32 tail = READ_ONCE(ring->tail);
+        u32 head = smp_load_acquire(&dev->head);
+        struct mychar_frame frame;
+        struct iovec iov;
+        struct iov_iter to;
+        u32 i;
+
+        if (head - tail > ring_size(dev))
+                return -EIO;
+
+        for (i = 0; i < count && head != tail; i++) {
+                struct mychar_rec *rec = &recs[i];
+
+                // tail may have been moved mid record through the mapping
+                if (head - tail < sizeof(frame)) {
+                        rec->status = -EIO;
+                        break;
+                }
+                ring_get(dev, tail, &frame, sizeof(frame));
+                if (frame.len > head - tail - sizeof(frame)) {
+                        rec->status = -EIO;
+                        break;
+                }
+                if (frame.len > rec->len) {
+                        rec->status = -EMSGSIZE;
+                        break;
+                }
+                if (import_single_range(READ, u64_to_user_ptr(rec->addr),
+                        frame.len, &iov, &to) < 0) {
+                        rec->status = -EFAULT;
+                        break;
+                }
+                if (ring_copy_out(dev, tail + sizeof(frame), frame.len, &to) != frame.len) {
+                        rec->status = -EFAULT;
+                        break;
+                }
+                tail += sizeof(frame) + frame.len;
+                rec->status = frame.len;
+        }
+
+        smp_store_release(&ring->tail, tail);
+        return i;
+}
 
 static int my_open(struct inode *i, struct file *f)
 {
         printk(KERN_INFO "Driver: open()\n");
-        return 0;
+        f->private_data = container_of(i->i_cdev, struct my_dev, c_dev);
+        return nonseekable_open(i, f);
+}
+
+static int my_fasync(int fd, struct file *f, int on)
+{
+        struct my_dev *dev = f->private_data;
+
+        return fasync_helper(fd, f, on, &dev->async_queue);
 }
 
 static int my_close(struct inode *i, struct file *f)
 {
+        my_fasync(-1, f, 0);
         printk(KERN_INFO "Driver: close()\n");
         return 0;
 }
 
-static ssize_t my_read(struct file *f, char __user *buf, size_t len, loff_t *off)
+static ssize_t my_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-        printk(KERN_INFO "Driver: read() with offset of %lld\n", *off);
-        if (*off > 0) {
+        struct file *f = iocb->ki_filp;
+        struct my_dev *dev = f->private_data;
+        size_t len = iov_iter_count(to);
+        ssize_t ret;
+
+        pr_debug("Driver: read()\n");
+        if (len == 0)
                 return 0;
+
+        if (mutex_lock_interruptible(&dev->read_lock))
+                return -ERESTARTSYS;
+        // like SO_RCVLOWAT, only blocking readers wait for the watermark
+        while (f->f_flags & O_NONBLOCK ? ring_used(dev) == 0 : !ring_readable_for(dev, len)) {
+                mutex_unlock(&dev->read_lock);
+                if (f->f_flags & O_NONBLOCK)
+                        return -EAGAIN;
+                if (wait_readable(dev, len))
+                        return -ERESTARTSYS;
+                if (mutex_lock_interruptible(&dev->read_lock))
+                        return -ERESTARTSYS;
         }
-        if (copy_to_user(buf, store, STORE_SIZE) != 0) {
-                return -EFAULT;
-        }
-        *off += STORE_SIZE; 
-        return STORE_SIZE;
+        ret = ring_consume(dev, to);
+        mutex_unlock(&dev->read_lock);
+
+        if (ret > 0)
+                wake_writers(dev);
+        return ret;
 }
 
-static ssize_t my_write(struct file *f, const char __user *buf, size_t len, loff_t *off)
+static ssize_t my_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-        printk(KERN_INFO "Driver: write()\n");
-        if (*off >= STORE_SIZE) {
-                return -ENOSPC;
+        struct file *f = iocb->ki_filp;
+        struct my_dev *dev = f->private_data;
+        size_t len = iov_iter_count(from);
+        ssize_t ret;
+
+        pr_debug("Driver: write()\n");
+        if (len == 0)
+                return 0;
+
+        if (mutex_lock_interruptible(&dev->write_lock))
+                return -ERESTARTSYS;
+        while (f->f_flags & O_NONBLOCK ? ring_free(dev) == 0 : !ring_writable_for(dev, len)) {
+                mutex_unlock(&dev->write_lock);
+                if (f->f_flags & O_NONBLOCK)
+                        return -EAGAIN;
+                if (wait_writable(dev, len))
+                        return -ERESTARTSYS;
+                if (mutex_lock_interruptible(&dev->write_lock))
+                        return -ERESTARTSYS;
         }
-        if (copy_from_user(store, buf, STORE_SIZE) != 0) {
+        ret = ring_produce(dev, from);
+        mutex_unlock(&dev->write_lock);
+
+        if (ret > 0)
+                wake_readers(dev);
+        return ret;
+}
+
+static unsigned int my_poll(struct file *f, poll_table *wait)
+{
+        struct my_dev *dev = f->private_data;
+        unsigned int mask = 0;
+
+        poll_wait(f, &dev->read_wait, wait);
+        poll_wait(f, &dev->write_wait, wait);
+
+        // mmap consumers move tail without a syscall, their poll() is the
+        // first chance to notice the space they handed back
+        if (f->f_mode & FMODE_READ)
+                wake_writers(dev);
+
+        if (ring_readable(dev))
+                mask |= POLLIN | POLLRDNORM;
+        if (ring_writable(dev))
+                mask |= POLLOUT | POLLWRNORM;
+        return mask;
+}
+
+static int set_watermarks(struct my_dev *dev, const struct mychar_watermarks *wm)
+{
+        if (wm->rx < 1 || wm->rx > ring_size(dev))
+                return -EINVAL;
+        if (wm->tx < 1 || wm->tx > ring_size(dev))
+                return -EINVAL;
+
+        WRITE_ONCE(dev->rx_wm, wm->rx);
+        WRITE_ONCE(dev->tx_wm, wm->tx);
+
+        // lowering a watermark may satisfy a sleeper right away
+        wake_readers(dev);
+        wake_writers(dev);
+        return 0;
+}
+
+static long my_ioctl_batch(struct my_dev *dev, unsigned int cmd,
+        struct mychar_batch __user *argp)
+{
+        struct mychar_batch batch;
+        struct mychar_rec *recs;
+        struct mutex *lock;
+        long ret;
+        u32 i;
+
+        if (copy_from_user(&batch, argp, sizeof(batch)) != 0)
                 return -EFAULT;
+        if (batch.flags != 0 || batch.count > MYCHAR_BATCH_MAX)
+                return -EINVAL;
+        if (batch.count == 0)
+                return 0;
+
+        recs = memdup_user(u64_to_user_ptr(batch.recs),
+                batch.count * sizeof(*recs));
+        if (IS_ERR(recs))
+                return PTR_ERR(recs);
+        for (i = 0; i < batch.count; i++)
+                recs[i].status = 0;
+
+        lock = cmd == MYCHAR_IOC_WRITE_BATCH ? &dev->write_lock : &dev->read_lock;
+        if (mutex_lock_interruptible(lock)) {
+                kfree(recs);
+                return -ERESTARTSYS;
+        }
+        if (cmd == MYCHAR_IOC_WRITE_BATCH)
+                ret = ring_produce_batch(dev, recs, batch.count);
+        else
+                ret = ring_consume_batch(dev, recs, batch.count);
+        mutex_unlock(lock);
+
+        if (ret > 0) {
+                if (cmd == MYCHAR_IOC_WRITE_BATCH)
+                        wake_readers(dev);
+                else
+                        wake_writers(dev);
+        }
+
+        // hand back the per record status, including the one that stopped us
+        if (ret >= 0 && copy_to_user(u64_to_user_ptr(batch.recs), recs,
+                min_t(u32, ret + 1, batch.count) * sizeof(*recs)) != 0)
+                ret = -EFAULT;
+        kfree(recs);
+        return ret;
+}
+
+static long my_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
+{
+        struct my_dev *dev = f->private_data;
+        void __user *argp = (void __user *)arg;
+        struct mychar_watermarks wm;
+
+        switch (cmd) {
+        case MYCHAR_IOC_GET_WATERMARKS:
+                wm.rx = READ_ONCE(dev->rx_wm);
+                wm.tx = READ_ONCE(dev->tx_wm);
+                if (copy_to_user(argp, &wm, sizeof(wm)) != 0)
+                        return -EFAULT;
+                return 0;
+        case MYCHAR_IOC_SET_WATERMARKS:
+                if (copy_from_user(&wm, argp, sizeof(wm)) != 0)
+                        return -EFAULT;
+                return set_watermarks(dev, &wm);
+        case MYCHAR_IOC_WRITE_BATCH:
+                if (!(f->f_mode & FMODE_WRITE))
+                        return -EBADF;
+                return my_ioctl_batch(dev, cmd, argp);
+        case MYCHAR_IOC_READ_BATCH:
+                if (!(f->f_mode & FMODE_READ))
+                        return -EBADF;
+                return my_ioctl_batch(dev, cmd, argp);
+        default:
+                return -ENOTTY;
         }
-        *off += STORE_SIZE; 
-        return STORE_SIZE;
+}
+
+static int my_mmap(struct file *f, struct vm_area_struct *vma)
+{
+        struct my_dev *dev = f->private_data;
+
+        // header page and data area, vmalloc_user() memory maps as is
+        return remap_vmalloc_range(vma, dev->ring, vma->vm_pgoff);
 }
 
 static struct file_operations pugs_fops =
@@ -59,49 +571,155 @@ static struct file_operations pugs_fops =
         .owner = THIS_MODULE,
         .open = my_open,
         .release = my_close,
-        .read = my_read,
-        .write = my_write
+        .read_iter = my_read_iter,
+        .write_iter = my_write_iter,
+        .splice_read = generic_file_splice_read,
+        .splice_write = iter_file_splice_write,
+        .poll = my_poll,
+        .unlocked_ioctl = my_ioctl,
+        .compat_ioctl = my_ioctl,
+        .fasync = my_fasync,
+        .mmap = my_mmap,
+        .llseek = no_llseek
 };
 
-static int __init char_init (void)
+static struct my_dev *dev_alloc(dev_t devt)
 {
-        // register device number
-        if (alloc_chrdev_region(&first, 0, 1, "mychar") < 0) {
-                return -1;
-        }
-        printk(KERN_INFO "<Major, Minor>: <%d, %d>\n", MAJOR(first), MINOR(first));
+        struct my_dev *dev;
+        size_t size = PAGE_SIZE << ring_order;
 
-        // create class
-        if ((cl = class_create(THIS_MODULE, "chardrv")) == NULL) {
-                unregister_chrdev_region(first, 1);
-                return -1;
+        dev = kmem_cache_zalloc(dev_cache, GFP_KERNEL);
+        if (!dev)
+                return NULL;
+
+        dev->ring = vmalloc_user(PAGE_SIZE + size);
+        if (!dev->ring) {
+                kmem_cache_free(dev_cache, dev);
+                return NULL;
         }
-        
-        // create device
-        if (device_create(cl, NULL, first, NULL, "mynull") == NULL) {
-                class_destroy(cl);
-                unregister_chrdev_region(first, 1);
-                return -1;
+
+        dev->ring->version = MYCHAR_RING_VERSION;
+        dev->ring->size = size;
+        dev->ring->data_offset = PAGE_SIZE;
+        dev->ring_data = (u8 *)dev->ring + PAGE_SIZE;
+        dev->ring_mask = size - 1;
+
+        // clamp the watermarks to something the ring can satisfy
+        dev->rx_wm = clamp_t(u32, rx_watermark, 1, size);
+        dev->tx_wm = clamp_t(u32, tx_watermark, 1, size);
+
+        dev->devt = devt;
+        atomic_set(&dev->rx_short, 0);
+        atomic_set(&dev->tx_short, 0);
+        mutex_init(&dev->write_lock);
+        mutex_init(&dev->read_lock);
+        init_waitqueue_head(&dev->write_wait);
+        init_waitqueue_head(&dev->read_wait);
+        cdev_init(&dev->c_dev, &pugs_fops);
+        dev->c_dev.owner = THIS_MODULE;
+        return dev;
+}
+
+static void dev_free(struct my_dev *dev)
+{
+        vfree(dev->ring);
+        kmem_cache_free(dev_cache, dev);
+}
+
+static int dev_add(int minor)
+{
+        struct my_dev *dev;
+        struct device *d;
+
+        dev = dev_alloc(MKDEV(MAJOR(first), MINOR(first) + minor));
+        if (!dev)
+                return -ENOMEM;
+
+        // create device, minor 0 keeps its historic name
+        if (minor == 0)
+                d = device_create(cl, NULL, dev->devt, NULL, "mynull");
+        else
+                d = device_create(cl, NULL, dev->devt, NULL, "mynull%d", minor);
+        if (IS_ERR_OR_NULL(d)) {
+                dev_free(dev);
+                return -ENOMEM;
         }
 
         // init char device
-        cdev_init(&c_dev, &pugs_fops);
-        if (cdev_add(&c_dev, first, 1) == -1) {
-                device_destroy(cl, first);
-                class_destroy(cl);
-                unregister_chrdev_region(first, 1);
-                return -1;
+        if (cdev_add(&dev->c_dev, dev->devt, 1) < 0) {
+                device_destroy(cl, dev->devt);
+                dev_free(dev);
+                return -ENOMEM;
+        }
+
+        devs[minor] = dev;
+        return 0;
+}
+
+static void dev_remove(int minor)
+{
+        struct my_dev *dev = devs[minor];
+
+        cdev_del(&dev->c_dev);
+        device_destroy(cl, dev->devt);
+        dev_free(dev);
+        devs[minor] = NULL;
+}
+
+static int __init char_init (void)
+{
+        int i;
+
+        BUILD_BUG_ON(sizeof(struct mychar_ring) > PAGE_SIZE);
+        if (ndevices < 1 || ndevices > MAX_DEVICES)
+                return -EINVAL;
+        if (ring_order < 0 || ring_order > 10)
+                return -EINVAL;
+
+        // per minor contexts
+        dev_cache = kmem_cache_create("mychar_dev", sizeof(struct my_dev), 0,
+                SLAB_HWCACHE_ALIGN, NULL);
+        if (!dev_cache)
+                return -ENOMEM;
+
+        // register device numbers
+        if (alloc_chrdev_region(&first, 0, ndevices, "mychar") < 0)
+                goto fail1;
+        printk(KERN_INFO "<Major, Minor>: <%d, %d>\n", MAJOR(first), MINOR(first));
+
+        // create class
+        cl = class_create(THIS_MODULE, "chardrv");
+        if (IS_ERR_OR_NULL(cl))
+                goto fail2;
+
+        // create devices
+        for (i = 0; i < ndevices; i++) {
+                if (dev_add(i) < 0)
+                        goto fail3;
         }
 
         return 0;
+
+fail3:
+        while (--i >= 0)
+                dev_remove(i);
+        class_destroy(cl);
+fail2:
+        unregister_chrdev_region(first, ndevices);
+fail1:
+        kmem_cache_destroy(dev_cache);
+        return -1;
 }
 
 static void __exit char_release (void)
 {
-        cdev_del(&c_dev);
-        device_destroy(cl, first);
+        int i;
+
+        for (i = 0; i < ndevices; i++)
+                dev_remove(i);
         class_destroy(cl);
-        unregister_chrdev_region(first, 1);
+        unregister_chrdev_region(first, ndevices);
+        kmem_cache_destroy(dev_cache);
         printk(KERN_INFO "Driver: exit\n");
 }
 
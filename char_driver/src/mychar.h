@@ -0,0 +1,104 @@
+#ifndef MYCHAR_H
+#define MYCHAR_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Layout of the mmap-able ring shared with userspace.
+ *
+ * Page 0 of the mapping holds struct mychar_ring, the data area of
+ * ring->size bytes (a power of two) starts at ring->data_offset.
+ * head and tail are free running byte counters, the amount of data
+ * available is head - tail and a position maps into the data area
+ * with (pos & (size - 1)).
+ *
+ * The driver is the only producer and owns head. There is a single
+ * consumer which owns tail: either read() or a userspace process
+ * working on the mapping, never both at the same time.
+ *
+ * Only tail is read back by the driver. version, size, data_offset and
+ * head are published for the consumer, changing them in the mapping has
+ * no effect on the driver.
+ *
+ * Userspace consumer protocol:
+ *   head = load_acquire(&ring->head);
+ *   consume data between tail and head;
+ *   store_release(&ring->tail, head);
+ *   poll() for POLLIN once head == tail.
+ */
+
+#define MYCHAR_RING_VERSION 1
+#define MYCHAR_CACHELINE 64
+
+struct mychar_ring {
+        __u32 version;
+        __u32 size;
+        __u32 data_offset;
+        __u32 pad0[MYCHAR_CACHELINE / 4 - 3];
+
+        // producer index, written by the driver only
+        __u32 head;
+        __u32 pad1[MYCHAR_CACHELINE / 4 - 1];
+
+        // consumer index, written by the consumer only
+        __u32 tail;
+        __u32 pad2[MYCHAR_CACHELINE / 4 - 1];
+};
+
+/*
+ * Wakeup watermarks in bytes. Blocking readers, POLLIN and SIGIO wait
+ * until at least rx bytes are queued, writers, POLLOUT and SIGIO until
+ * at least tx bytes are free. A read or write asking for fewer bytes
+ * than the watermark only waits for its own length. Raising them
+ * batches bursty producers into fewer wakeups. Both must be between 1
+ * and ring->size.
+ */
+struct mychar_watermarks {
+        __u32 rx;
+        __u32 tx;
+};
+
+/*
+ * Record descriptor for the batch ioctls. addr/len describe a user
+ * buffer, status returns the number of bytes transferred or -errno.
+ */
+struct mychar_rec {
+        __u64 addr;
+        __u32 len;
+        __s32 status;
+};
+
+/*
+ * Batch of count records at recs (a user pointer to struct mychar_rec).
+ * MYCHAR_IOC_WRITE_BATCH enqueues each record whole or stops at the
+ * first one that doesn't fit with -ENOSPC. MYCHAR_IOC_READ_BATCH
+ * dequeues one whole record into each buffer until the ring is empty,
+ * a buffer shorter than its record fails with -EMSGSIZE and leaves the
+ * record queued. Neither blocks, both return the number of records
+ * completed. flags must be 0.
+ *
+ * Batched records keep their boundaries: each is queued behind a
+ * struct mychar_frame. read() and mmap consumers see the frames as part
+ * of the stream, and READ_BATCH fails with -EIO on data not written by
+ * WRITE_BATCH, so don't mix batches with plain write() on one minor.
+ */
+struct mychar_frame {
+        __u32 len; // bytes of record data following the frame
+};
+
+struct mychar_batch {
+        __u64 recs;
+        __u32 count;
+        __u32 flags;
+};
+
+#define MYCHAR_BATCH_MAX 1024
+
+#define MYCHAR_IOC_MAGIC 'm'
+#define MYCHAR_IOC_GET_WATERMARKS _IOR(MYCHAR_IOC_MAGIC, 1, struct mychar_watermarks)
+#define MYCHAR_IOC_SET_WATERMARKS _IOW(MYCHAR_IOC_MAGIC, 2, struct mychar_watermarks)
+#define MYCHAR_IOC_WRITE_BATCH _IOW(MYCHAR_IOC_MAGIC, 3, struct mychar_batch)
+#define MYCHAR_IOC_READ_BATCH _IOW(MYCHAR_IOC_MAGIC, 4, struct mychar_batch)
+
+#endif
@@ -1,20 +1,353 @@
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/device.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+
+#include "myclass.h"
+
+#define MAX_TYPES 16
+#define MAX_CREATE 4096 // devices per write to the create attribute
+#define NAME_LEN 32
+
+static unsigned int uevent_delay_ms = 10; // window to collect ADD uevents
+module_param(uevent_delay_ms, uint, 0644);
+
+struct myclass_dev {
+        struct device dev;
+        struct list_head node; // on devices
+        struct list_head pending; // on pending until the ADD uevent went out
+        bool user; // created through the create attribute, not owned by a module
+};
 
 struct class* myclass;
+static struct device_type* types[MAX_TYPES];
+static LIST_HEAD(devices);
+static LIST_HEAD(pending);
+static DEFINE_MUTEX(myclass_lock); // protects types, devices and pending
+static DEFINE_MUTEX(myclass_add_lock); // serializes adding and removing devices
+
+static void uevent_flush(struct work_struct* work);
+static DECLARE_DELAYED_WORK(uevent_work, uevent_flush);
+
+/*
+ * Emit the held back ADD uevents in one go. Removals hold
+ * myclass_add_lock, so holding it here keeps every device of the batch
+ * registered until its ADD went out. myclass_lock is only taken to
+ * move the batch off pending, lookups do not wait for the uevents.
+ */
+static void uevent_flush(struct work_struct* work)
+{
+        struct myclass_dev *md, *tmp;
+        LIST_HEAD(batch);
+
+        mutex_lock(&myclass_add_lock);
+        mutex_lock(&myclass_lock);
+        list_splice_init(&pending, &batch);
+        mutex_unlock(&myclass_lock);
+
+        list_for_each_entry_safe(md, tmp, &batch, pending) {
+                list_del_init(&md->pending);
+                dev_set_uevent_suppress(&md->dev, 0);
+                kobject_uevent(&md->dev.kobj, KOBJ_ADD);
+        }
+        mutex_unlock(&myclass_add_lock);
+}
+
+static void myclass_release(struct device* dev)
+{
+        kfree(container_of(dev, struct myclass_dev, dev));
+}
+
+int myclass_register_type(struct device_type* type)
+{
+        int i;
+        int retval = -ENOSPC;
+
+        if (!type->name)
+                return -EINVAL;
+
+        mutex_lock(&myclass_lock);
+        for (i = 0; i < MAX_TYPES; i++) {
+                if (types[i] && !strcmp(types[i]->name, type->name)) {
+                        retval = -EEXIST;
+                        break;
+                }
+        }
+        for (i = 0; i < MAX_TYPES && retval == -ENOSPC; i++) {
+                if (!types[i]) {
+                        types[i] = type;
+                        retval = 0;
+                }
+        }
+        mutex_unlock(&myclass_lock);
+        return retval;
+}
+EXPORT_SYMBOL_GPL(myclass_register_type);
+
+/*
+ * take the first device matching type (any if NULL) or name off the
+ * list, with user only those created from userspace
+ */
+static struct myclass_dev* myclass_take(struct device_type* type, const char* name,
+        bool user)
+{
+        struct myclass_dev* md;
+
+        mutex_lock(&myclass_lock);
+        list_for_each_entry(md, &devices, node) {
+                if (user && !md->user)
+                        continue;
+                if (type && md->dev.type != type)
+                        continue;
+                if (name && strcmp(dev_name(&md->dev), name))
+                        continue;
+                list_del(&md->node);
+                list_del_init(&md->pending);
+                mutex_unlock(&myclass_lock);
+                return md;
+        }
+        mutex_unlock(&myclass_lock);
+        return NULL;
+}
+
+void myclass_unregister_type(struct device_type* type)
+{
+        struct myclass_dev* md;
+        int i;
+
+        // wait for a create in progress, it may still use type
+        mutex_lock(&myclass_add_lock);
+        mutex_lock(&myclass_lock);
+        for (i = 0; i < MAX_TYPES; i++) {
+                if (types[i] == type)
+                        types[i] = NULL;
+        }
+        mutex_unlock(&myclass_lock);
+
+        // devices added by a module stay, they are its to delete
+        while ((md = myclass_take(type, NULL, true)) != NULL)
+                device_unregister(&md->dev);
+        mutex_unlock(&myclass_add_lock);
+}
+EXPORT_SYMBOL_GPL(myclass_unregister_type);
+
+// caller holds myclass_add_lock
+static struct device* __myclass_device_add(struct device_type* type, const char* name,
+        bool user)
+{
+        struct myclass_dev *md, *other;
+        int retval;
+
+        md = kzalloc(sizeof(*md), GFP_KERNEL);
+        if (!md)
+                return ERR_PTR(-ENOMEM);
+
+        device_initialize(&md->dev);
+        md->dev.class = myclass;
+        md->dev.type = type;
+        md->dev.release = myclass_release;
+        md->user = user;
+        INIT_LIST_HEAD(&md->pending);
+        retval = dev_set_name(&md->dev, "%s", name);
+        if (retval)
+                goto fail;
+
+        // sysfs warns about duplicates, removals also hold myclass_add_lock
+        mutex_lock(&myclass_lock);
+        list_for_each_entry(other, &devices, node) {
+                if (!strcmp(dev_name(&other->dev), name)) {
+                        retval = -EEXIST;
+                        break;
+                }
+        }
+        mutex_unlock(&myclass_lock);
+        if (retval)
+                goto fail;
+
+        // type groups are added by device_add() before anyone is told
+        dev_set_uevent_suppress(&md->dev, 1);
+        retval = device_add(&md->dev);
+        if (retval)
+                goto fail;
+
+        mutex_lock(&myclass_lock);
+        list_add_tail(&md->node, &devices);
+        list_add_tail(&md->pending, &pending);
+        mutex_unlock(&myclass_lock);
+
+        schedule_delayed_work(&uevent_work, msecs_to_jiffies(uevent_delay_ms));
+        return &md->dev;
+
+fail:
+        put_device(&md->dev);
+        return ERR_PTR(retval);
+}
+
+struct device* myclass_device_add(struct device_type* type, const char* name)
+{
+        struct device* dev;
+
+        mutex_lock(&myclass_add_lock);
+        dev = __myclass_device_add(type, name, false);
+        mutex_unlock(&myclass_add_lock);
+        return dev;
+}
+EXPORT_SYMBOL_GPL(myclass_device_add);
+
+void myclass_device_del(struct device* dev)
+{
+        struct myclass_dev* md = container_of(dev, struct myclass_dev, dev);
+
+        mutex_lock(&myclass_add_lock);
+        mutex_lock(&myclass_lock);
+        list_del(&md->node);
+        // never announced, keep the REMOVE uevent suppressed as well
+        list_del_init(&md->pending);
+        mutex_unlock(&myclass_lock);
+
+        device_unregister(dev);
+        mutex_unlock(&myclass_add_lock);
+}
+EXPORT_SYMBOL_GPL(myclass_device_del);
+
+static struct device_type* myclass_find_type(const char* name)
+{
+        struct device_type* type = NULL;
+        int i;
+
+        mutex_lock(&myclass_lock);
+        for (i = 0; i < MAX_TYPES; i++) {
+                if (types[i] && !strcmp(types[i]->name, name)) {
+                        type = types[i];
+                        break;
+                }
+        }
+        mutex_unlock(&myclass_lock);
+        return type;
+}
+
+// "<type> <name> [<count>]", count > 1 creates <name>0 .. <name><count-1>
+static ssize_t create_store(struct class* class, struct class_attribute* attr,
+        const char* buf, size_t count)
+{
+        char type_name[NAME_LEN], name[NAME_LEN], devname[NAME_LEN + 8];
+        struct device_type* type;
+        struct device* dev;
+        unsigned int n = 1;
+        unsigned int i;
+        ssize_t retval = count;
+
+        if (sscanf(buf, "%31s %31s %u", type_name, name, &n) < 2)
+                return -EINVAL;
+        if (n < 1 || n > MAX_CREATE)
+                return -EINVAL;
+
+        // the type must not be unregistered between lookup and the last add
+        mutex_lock(&myclass_add_lock);
+        type = myclass_find_type(type_name);
+        if (!type)
+                retval = -ENODEV;
+
+        for (i = 0; type && i < n; i++) {
+                if (n == 1)
+                        strlcpy(devname, name, sizeof(devname));
+                else
+                        snprintf(devname, sizeof(devname), "%s%u", name, i);
+                dev = __myclass_device_add(type, devname, true);
+                if (IS_ERR(dev)) {
+                        retval = PTR_ERR(dev);
+                        break;
+                }
+        }
+        mutex_unlock(&myclass_add_lock);
+        return retval;
+}
+
+static ssize_t destroy_store(struct class* class, struct class_attribute* attr,
+        const char* buf, size_t count)
+{
+        char name[NAME_LEN];
+        struct myclass_dev* md;
+
+        if (sscanf(buf, "%31s", name) != 1)
+                return -EINVAL;
+
+        mutex_lock(&myclass_add_lock);
+        // only what create made, modules still hold pointers to theirs
+        md = myclass_take(NULL, name, true);
+        if (md)
+                device_unregister(&md->dev);
+        mutex_unlock(&myclass_add_lock);
+        return md ? count : -ENODEV;
+}
+
+static struct class_attribute create_attribute = __ATTR(create, 0200, NULL, create_store);
+static struct class_attribute destroy_attribute = __ATTR(destroy, 0200, NULL, destroy_store);
+
+// built in type so the class can be exercised without another module
+static ssize_t hello_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+        return sprintf(buf, "hello %s!\n", dev_name(dev));
+}
+static DEVICE_ATTR_RO(hello);
+
+static struct attribute* example_attrs[] = {
+        &dev_attr_hello.attr,
+        NULL,
+};
+ATTRIBUTE_GROUPS(example);
+
+static struct device_type example_type = {
+        .name = "example",
+        .groups = example_groups,
+};
 
 static int __init hello_init (void)
 {
+        int retval;
+
         myclass = class_create(THIS_MODULE, "myclass");
         if (IS_ERR(myclass))
                 return -ENOMEM;
+
+        retval = class_create_file(myclass, &create_attribute);
+        if (retval)
+                goto fail1;
+        retval = class_create_file(myclass, &destroy_attribute);
+        if (retval)
+                goto fail2;
+        retval = myclass_register_type(&example_type);
+        if (retval)
+                goto fail3;
         return 0;
+
+fail3:
+        class_remove_file(myclass, &destroy_attribute);
+fail2:
+        class_remove_file(myclass, &create_attribute);
+fail1:
+        class_destroy(myclass);
+        return retval;
 }
 
 static void __exit hello_release (void)
 {
+        struct myclass_dev* md;
+
+        class_remove_file(myclass, &destroy_attribute);
+        class_remove_file(myclass, &create_attribute);
+        myclass_unregister_type(&example_type);
+        cancel_delayed_work_sync(&uevent_work);
+        mutex_lock(&myclass_add_lock);
+        while ((md = myclass_take(NULL, NULL, false)) != NULL)
+                device_unregister(&md->dev);
+        mutex_unlock(&myclass_add_lock);
         class_destroy(myclass);
 }
 
@@ -0,0 +1,28 @@
+#ifndef MYCLASS_H
+#define MYCLASS_H
+
+#include <linux/device.h>
+
+/*
+ * Shared class layer for "myclass". Drivers describe their devices with
+ * a struct device_type, its groups are created together with the device
+ * so userspace never sees a half populated directory.
+ *
+ * Devices can be added from code or lazily from userspace by writing
+ * "<type> <name> [<count>]" to /sys/class/myclass/create, and removed by
+ * writing the name to /sys/class/myclass/destroy. ADD uevents are held
+ * back and emitted in batches, see uevent_delay_ms.
+ *
+ * A device added with myclass_device_add() belongs to the caller until
+ * it calls myclass_device_del(). Neither destroy nor
+ * myclass_unregister_type() touch it, they only remove devices created
+ * from userspace. Delete your devices before unregistering their type.
+ */
+
+int myclass_register_type(struct device_type* type);
+void myclass_unregister_type(struct device_type* type);
+
+struct device* myclass_device_add(struct device_type* type, const char* name);
+void myclass_device_del(struct device* dev);
+
+#endif
@@ -1,13 +1,177 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/init.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/sysfs.h>
+#include <linux/slab.h>
+
+#include "metrics.h"
+#include "tunables.h"
 
 static struct kobject* example;
-static int note;
+static struct tunable note = TUNABLE_INT(note, 0, INT_MIN, INT_MAX);
+
+// registered counters, free slots have counter == NULL
+static struct metric {
+        char name[METRICS_NAME_LEN];
+        u64 __percpu *counter;
+} metrics[METRICS_MAX];
+static u32 metrics_generation; // bumped whenever the layout changes
+static DEFINE_MUTEX(metrics_lock); // protects metrics and metrics_generation
+
+static ssize_t metrics_read(struct file* f, struct kobject* kobj, struct bin_attribute* attr,
+        char* buf, loff_t off, size_t count);
+static struct bin_attribute metrics_attribute = {
+        .attr = { .name = "metrics", .mode = 0444 },
+        .size = METRICS_SIZE,
+        .read = metrics_read,
+};
+
+int metrics_register(const char* name, u64 __percpu* counter)
+{
+        int i;
+        int retval = -ENOSPC;
+
+        if (!name || !counter)
+                return -EINVAL;
+
+        mutex_lock(&metrics_lock);
+        for (i = 0; i < METRICS_MAX; i++) {
+                if (metrics[i].counter)
+                        continue;
+                strlcpy(metrics[i].name, name, METRICS_NAME_LEN);
+                metrics[i].counter = counter;
+                metrics_generation++;
+                retval = 0;
+                break;
+        }
+        mutex_unlock(&metrics_lock);
+        return retval;
+}
+EXPORT_SYMBOL_GPL(metrics_register);
+
+void metrics_unregister(u64 __percpu* counter)
+{
+        int i;
+
+        mutex_lock(&metrics_lock);
+        for (i = 0; i < METRICS_MAX; i++) {
+                if (metrics[i].counter == counter) {
+                        metrics[i].counter = NULL;
+                        metrics_generation++;
+                        break;
+                }
+        }
+        mutex_unlock(&metrics_lock);
+}
+EXPORT_SYMBOL_GPL(metrics_unregister);
+
+ssize_t tunable_show(struct kobject* kobj, struct kobj_attribute* attr, char* buf)
+{
+        struct tunable* t = container_of(attr, struct tunable, attr);
+        int value = tunable_get(t);
+
+        if (t->type == TUNABLE_ENUM)
+                return sprintf(buf, "%s\n", t->names[value]);
+        return sprintf(buf, "%d\n", value);
+}
+EXPORT_SYMBOL_GPL(tunable_show);
+
+ssize_t tunable_store(struct kobject* kobj, struct kobj_attribute* attr, const char* buf, size_t count)
+{
+        struct tunable* t = container_of(attr, struct tunable, attr);
+        int value;
+        bool flag;
+
+        switch (t->type) {
+        case TUNABLE_INT:
+                if (kstrtoint(buf, 0, &value))
+                        return -EINVAL;
+                break;
+        case TUNABLE_BOOL:
+                if (strtobool(buf, &flag))
+                        return -EINVAL;
+                value = flag;
+                break;
+        case TUNABLE_ENUM:
+                for (value = 0; t->names[value]; value++) {
+                        if (sysfs_streq(buf, t->names[value]))
+                                break;
+                }
+                if (!t->names[value])
+                        return -EINVAL;
+                break;
+        default:
+                return -EINVAL;
+        }
+
+        if (value < t->min || value > t->max)
+                return -ERANGE;
 
-static ssize_t note_read(struct kobject* kobj, struct kobj_attribute* attr, char* buf);
-static ssize_t note_write(struct kobject* kobj, struct kobj_attribute* attr, const char* buf, size_t count);
-static struct kobj_attribute note_attribute = __ATTR(note, 0444, note_read, note_write);
+        // only wake pollers on an actual change
+        if (atomic_xchg(&t->value, value) != value)
+                sysfs_notify(kobj, NULL, attr->attr.name);
+        return count;
+}
+EXPORT_SYMBOL_GPL(tunable_store);
+
+int tunable_register(struct tunable* t)
+{
+        int value = tunable_get(t);
+
+        // the names bound an enum, not the placeholder max from the macro
+        if (t->type == TUNABLE_ENUM) {
+                if (!t->names || !t->names[0])
+                        return -EINVAL;
+                for (t->max = 0; t->names[t->max + 1]; t->max++)
+                        ;
+        }
+        if (value < t->min || value > t->max)
+                return -ERANGE;
+        return sysfs_create_file(example, &t->attr.attr);
+}
+EXPORT_SYMBOL_GPL(tunable_register);
+
+void tunable_unregister(struct tunable* t)
+{
+        sysfs_remove_file(example, &t->attr.attr);
+}
+EXPORT_SYMBOL_GPL(tunable_unregister);
+
+// fill snapshot with all registered counters, caller holds metrics_lock
+static size_t metrics_snapshot(u8* snapshot)
+{
+        struct metrics_header* header = (struct metrics_header*)snapshot;
+        struct metrics_entry* entry = (struct metrics_entry*)(header + 1);
+        struct metrics_trailer* trailer;
+        int i, cpu;
+
+        header->magic = METRICS_MAGIC;
+        header->version = METRICS_VERSION;
+        header->entry_size = sizeof(*entry);
+        header->count = 0;
+        header->generation = metrics_generation;
+        header->reserved = 0;
+
+        for (i = 0; i < METRICS_MAX; i++) {
+                if (!metrics[i].counter)
+                        continue;
+                memcpy(entry->name, metrics[i].name, METRICS_NAME_LEN);
+                entry->value = 0;
+                for_each_possible_cpu(cpu)
+                        entry->value += *per_cpu_ptr(metrics[i].counter, cpu);
+                header->count++;
+                entry++;
+        }
+
+        trailer = (struct metrics_trailer*)entry;
+        trailer->magic = METRICS_MAGIC;
+        trailer->generation = metrics_generation;
+        return (u8*)(trailer + 1) - snapshot;
+}
 
 static int __init hello_init (void)
 {
@@ -19,7 +183,14 @@ static int __init hello_init (void)
                 return -ENOMEM;
 
         // create note attribute
-        retval = sysfs_create_file(example, &note_attribute.attr);
+        retval = tunable_register(&note);
+        if (retval) {
+                kobject_put(example);
+                return retval;
+        }
+
+        // create metrics attribute
+        retval = sysfs_create_bin_file(example, &metrics_attribute);
         if (retval)
                 kobject_put(example);
 
@@ -28,17 +199,37 @@ static int __init hello_init (void)
 
 static void __exit hello_release (void)
 {
+        sysfs_remove_bin_file(example, &metrics_attribute);
         kobject_put(example);
 }
 
-static ssize_t note_read(struct kobject* kobj, struct kobj_attribute* attr, char* buf) 
+/*
+ * sysfs hands out binary attributes a page at a time. Every call takes
+ * its own snapshot so concurrent readers never share state, the
+ * generation in header and trailer tells a reader whether its chunks
+ * fit together.
+ */
+static ssize_t metrics_read(struct file* f, struct kobject* kobj, struct bin_attribute* attr,
+        char* buf, loff_t off, size_t count)
 {
-        return sprintf(buf, "hello sysfs!\n");
-}
+        u8* snapshot;
+        size_t len;
 
-static ssize_t note_write(struct kobject* kobj, struct kobj_attribute* attr, const char* buf, size_t count)
-{
-        return 0;
+        snapshot = kmalloc(METRICS_SIZE, GFP_KERNEL);
+        if (!snapshot)
+                return -ENOMEM;
+
+        mutex_lock(&metrics_lock);
+        len = metrics_snapshot(snapshot);
+        mutex_unlock(&metrics_lock);
+
+        if (off >= len)
+                count = 0;
+        else
+                count = min_t(size_t, count, len - off);
+        memcpy(buf, snapshot + off, count);
+        kfree(snapshot);
+        return count;
 }
 
 
@@ -0,0 +1,54 @@
+#ifndef SYSFS_FILE_METRICS_H
+#define SYSFS_FILE_METRICS_H
+
+#include <linux/types.h>
+
+/*
+ * Layout of /sys/example/metrics. A read returns a header followed by
+ * header.count entries of header.entry_size bytes each. Free slots
+ * are skipped, so entries are always dense. Counters registered by
+ * other modules are summed over all cpus at the time of the read.
+ *
+ * A trailer follows the last entry. sysfs hands the file out a page at
+ * a time and every chunk comes from a fresh snapshot, so a full read
+ * can mix several. Their layout only differs if a counter was
+ * registered or unregistered in between, which bumps the generation.
+ * A read whose header and trailer generation differ is torn, retry it.
+ */
+
+#define METRICS_MAGIC 0x4d455452 // "METR"
+#define METRICS_VERSION 1
+#define METRICS_NAME_LEN 24
+#define METRICS_MAX 256
+
+struct metrics_header {
+        __u32 magic;
+        __u32 version;
+        __u32 count;
+        __u32 entry_size;
+        __u32 generation;
+        __u32 reserved;
+};
+
+struct metrics_entry {
+        char name[METRICS_NAME_LEN];
+        __u64 value;
+};
+
+struct metrics_trailer {
+        __u32 magic;
+        __u32 generation;
+};
+
+#define METRICS_SIZE (sizeof(struct metrics_header) + \
+        METRICS_MAX * sizeof(struct metrics_entry) + \
+        sizeof(struct metrics_trailer))
+
+#ifdef __KERNEL__
+#include <linux/percpu.h>
+
+int metrics_register(const char *name, u64 __percpu *counter);
+void metrics_unregister(u64 __percpu *counter);
+#endif
+
+#endif
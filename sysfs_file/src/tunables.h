@@ -0,0 +1,58 @@
+#ifndef SYSFS_FILE_TUNABLES_H
+#define SYSFS_FILE_TUNABLES_H
+
+#include <linux/kernel.h>
+#include <linux/sysfs.h>
+#include <linux/atomic.h>
+
+/*
+ * Runtime tunables published as files below /sys/example. A store
+ * validates the new value and swaps it in atomically, so hot paths read
+ * it with tunable_get() without taking a lock. Every change is
+ * signalled with sysfs_notify(), userspace can poll() for POLLPRI on
+ * the attribute to learn about it.
+ */
+
+enum tunable_type {
+        TUNABLE_INT,  // integer between min and max
+        TUNABLE_BOOL, // 0/1, y/n, on/off
+        TUNABLE_ENUM, // index into a NULL terminated list of names
+};
+
+struct tunable {
+        struct kobj_attribute attr;
+        enum tunable_type type;
+        int min, max;
+        const char * const *names;
+        atomic_t value;
+};
+
+ssize_t tunable_show(struct kobject* kobj, struct kobj_attribute* attr, char* buf);
+ssize_t tunable_store(struct kobject* kobj, struct kobj_attribute* attr, const char* buf, size_t count);
+
+#define __TUNABLE(_name, _type, _def, _min, _max, _names) { \
+        .attr = __ATTR(_name, 0644, tunable_show, tunable_store), \
+        .type = _type, \
+        .min = _min, \
+        .max = _max, \
+        .names = _names, \
+        .value = ATOMIC_INIT(_def), \
+}
+
+#define TUNABLE_INT(_name, _def, _min, _max) \
+        __TUNABLE(_name, TUNABLE_INT, _def, _min, _max, NULL)
+#define TUNABLE_BOOL(_name, _def) \
+        __TUNABLE(_name, TUNABLE_BOOL, _def, 0, 1, NULL)
+// max is set from the number of names by tunable_register()
+#define TUNABLE_ENUM(_name, _def, _names) \
+        __TUNABLE(_name, TUNABLE_ENUM, _def, 0, 0, _names)
+
+static inline int tunable_get(struct tunable* t)
+{
+        return atomic_read(&t->value);
+}
+
+int tunable_register(struct tunable* t);
+void tunable_unregister(struct tunable* t);
+
+#endif